@@ -7,6 +7,8 @@
 
 #include <memory>
 #include <iostream>
+#include <stdexcept>
+#include <vector>
 #include "buffer.h"
 #include "exceptions/buffer_exceeded_exception.h"
 #include "exceptions/page_not_pinned_exception.h"
@@ -28,7 +30,10 @@ namespace badgerdb
 			bufDescTable[i].valid = false;
 		}
 
-		bufPool = new Page[bufs];
+		// 每个页框单独分配，resize()时已pin住的页面不会被移动
+		bufPool.resize(bufs);
+		for (FrameId i = 0; i < bufs; i++)
+			bufPool[i] = new Page();
 
 		int htsize = ((((int)(bufs * 1.2)) * 2) / 2) + 1;
 		hashTable = new BufHashTbl(htsize); // allocate the buffer hash table
@@ -44,14 +49,15 @@ namespace badgerdb
 		{
 			if (bufDescTable[i].dirty && bufDescTable[i].valid)
 			{
-				bufDescTable[i].file->writePage(bufPool[i]);
+				bufDescTable[i].file->writePage(*bufPool[i]);
 				bufDescTable[i].dirty = false;
 			}
 		}
 
 		// 按指向顺序删除，避免产生空指针
-		delete hashTable;	   // 删除页表
-		delete[] bufPool;	   // 删除 Buffer Pool
+		delete hashTable; // 删除页表
+		for (FrameId i = 0; i < numBufs; i++)
+			delete bufPool[i]; // 删除 Buffer Pool
 		delete[] bufDescTable; // 删除每一个页框的描述
 	}
 
@@ -98,7 +104,7 @@ namespace badgerdb
 			if (bufDescTable[clockHand].dirty)
 			{
 				bufDescTable[clockHand].dirty = false;
-				bufDescTable[clockHand].file->writePage(bufPool[clockHand]);
+				bufDescTable[clockHand].file->writePage(*bufPool[clockHand]);
 			}
 			// 如果被分配的页框中包含一个有效页面，则必须将该页面从页表中删除
 			if (bufDescTable[clockHand].valid)
@@ -125,16 +131,16 @@ namespace badgerdb
 			hashTable->lookup(file, pageNo, frame_num);
 			bufDescTable[frame_num].refbit = true;
 			bufDescTable[frame_num].pinCnt++;
-			page = frame_num + bufPool; // 通过参数page返回指向该页框的指针
+			page = bufPool[frame_num]; // 通过参数page返回指向该页框的指针
 		}
 		// 页面不在缓冲池中
 		catch (HashNotFoundException &)
 		{
 			allocBuf(frame_num);						 // 分配一个空闲的页框
-			bufPool[frame_num] = file->readPage(pageNo); // 将页面从磁盘读入刚刚分配的空闲页框
+			*bufPool[frame_num] = file->readPage(pageNo); // 将页面从磁盘读入刚刚分配的空闲页框
 			hashTable->insert(file, pageNo, frame_num);	 // 将该页面插入哈希表
 			bufDescTable[frame_num].Set(file, pageNo);	 // 调用Set()方法正确设置页框的状态
-			page = frame_num + bufPool;					 // 通过参数page返回指向该页框的指针
+			page = bufPool[frame_num];					 // 通过参数page返回指向该页框的指针
 		}
 	}
 
@@ -164,22 +170,28 @@ namespace badgerdb
 	// 扫描页面
 	void BufMgr::flushFile(const File *file)
 	{
-		// 遍历，检索缓冲区中所有属于文件file的页面
+		// 先检查，检索到文件file的某个无效页或文件file的某些页面被固定住(pinned)时抛出异常，此时不修改任何页框
 		for (FrameId i = 0; i < numBufs; i++)
 		{
 			if (bufDescTable[i].file == file)
 			{
-				// 检索到文件file的某个无效页或文件file的某些页面被固定住(pinned)，抛出BadBufferException异常
 				if (!bufDescTable[i].valid)
 					throw BadBufferException(i, bufDescTable[i].dirty, bufDescTable[i].valid, bufDescTable[i].refbit);
 				if (bufDescTable[i].pinCnt > 0)
 				{
 					throw PagePinnedException(file->filename(), bufDescTable[i].pageNo, i);
 				}
+			}
+		}
+		// 遍历，检索缓冲区中所有属于文件file的页面
+		for (FrameId i = 0; i < numBufs; i++)
+		{
+			if (bufDescTable[i].file == file)
+			{
 				// 如果页面是脏的，则调用file->writePage()将页面写回磁盘，并将dirty位置为false
 				if (bufDescTable[i].dirty)
 				{
-					bufDescTable[i].file->writePage(bufPool[i]);
+					bufDescTable[i].file->writePage(*bufPool[i]);
 					bufDescTable[i].dirty = false;
 				}
 				// 将页面从哈希表中删除
@@ -197,10 +209,10 @@ namespace badgerdb
 
 		Page new_page = file->allocatePage(); // 在file文件中分配一个空闲页面
 		allocBuf(frame_num);				  // 在缓冲区中分配一个空闲的页框
-		bufPool[frame_num] = new_page;
+		*bufPool[frame_num] = new_page;
 
 		pageNo = new_page.page_number(); // 通过pageNo参数返回新分配的页面的页号
-		page = frame_num + bufPool;		 // 通过page参数返回指向缓冲池中包含该页面的页框的指针
+		page = bufPool[frame_num];		 // 通过page参数返回指向缓冲池中包含该页面的页框的指针
 
 		hashTable->insert(file, pageNo, frame_num); // 在哈希表中插入一条项目
 		bufDescTable[frame_num].Set(file, pageNo);	// 调用Set()方法正确设置页框的状态
@@ -223,6 +235,77 @@ namespace badgerdb
 		file->deletePage(PageNo); // 从file中删除该页面
 	}
 
+	// 运行时将缓冲池调整为 bufs 个页框，BufMgr 对象本身和已pin住的页面都保持不动。
+	// 增大时只追加空闲页框；缩小时需将编号不小于 bufs 的页框清出，若其中有页面被pin则抛出PagePinnedException异常且不修改任何页框
+	void BufMgr::resize(std::uint32_t bufs)
+	{
+		if (bufs == numBufs)
+			return;
+		if (bufs == 0)
+			throw std::invalid_argument("buffer pool needs at least one frame");
+
+		for (FrameId i = bufs; i < numBufs; i++)
+		{
+			if (bufDescTable[i].valid && bufDescTable[i].pinCnt > 0)
+				throw PagePinnedException(bufDescTable[i].file->filename(), bufDescTable[i].pageNo, i);
+		}
+
+		// 先分配新的BufDesc表、哈希表和新增的页框，分配失败时缓冲池保持不变
+		BufDesc *newDescTable = new BufDesc[bufs];
+		int htsize = ((((int)(bufs * 1.2)) * 2) / 2) + 1;
+		BufHashTbl *newHashTable = NULL;
+		std::vector<Page *> newFrames;
+		try
+		{
+			newHashTable = new BufHashTbl(htsize);
+			for (FrameId i = numBufs; i < bufs; i++)
+				newFrames.push_back(new Page());
+		}
+		catch (...)
+		{
+			for (std::size_t i = 0; i < newFrames.size(); i++)
+				delete newFrames[i];
+			delete newHashTable;
+			delete[] newDescTable;
+			throw;
+		}
+
+		// 清出将被删除的页框，脏页全部写回磁盘后再释放页框
+		for (FrameId i = bufs; i < numBufs; i++)
+		{
+			if (bufDescTable[i].valid && bufDescTable[i].dirty)
+			{
+				bufDescTable[i].file->writePage(*bufPool[i]);
+				bufDescTable[i].dirty = false;
+			}
+		}
+		for (FrameId i = bufs; i < numBufs; i++)
+			delete bufPool[i];
+
+		// 保留的页框原样搬到新表中，并重新插入新的哈希表
+		for (FrameId i = 0; i < bufs; i++)
+		{
+			if (i < numBufs)
+				newDescTable[i] = bufDescTable[i];
+			newDescTable[i].frameNo = i;
+			if (i >= numBufs)
+				newDescTable[i].valid = false;
+			if (newDescTable[i].valid)
+				newHashTable->insert(newDescTable[i].file, newDescTable[i].pageNo, i);
+		}
+		bufPool.resize(bufs);
+		for (FrameId i = numBufs; i < bufs; i++)
+			bufPool[i] = newFrames[i - numBufs];
+
+		delete hashTable;
+		delete[] bufDescTable;
+		hashTable = newHashTable;
+		bufDescTable = newDescTable;
+		numBufs = bufs;
+		if (clockHand >= numBufs)
+			clockHand = numBufs - 1;
+	}
+
 	void BufMgr::printSelf(void)
 	{
 		BufDesc *tmpbuf;
@@ -241,4 +324,191 @@ namespace badgerdb
 		std::cout << "Total Number of Valid Frames:" << validFrames << "\n";
 	}
 
+	const std::string BufPoolManager::DEFAULT_POOL = "default";
+	const std::string BufPoolManager::TEMP_POOL = "temp";
+
+	// 创建总共 totalBufs 个页框的多缓冲池管理器：默认池至少保留 defaultBufs 个页框，
+	// 临时池至少保留 tempBufs 个页框，两者都可以增长到对方最小配额以外的全部页框
+	BufPoolManager::BufPoolManager(std::uint32_t totalBufs, std::uint32_t defaultBufs, std::uint32_t tempBufs)
+		: totalBufs(totalBufs), usedBufs(0)
+	{
+		// 创建任何缓冲池之前先检查两个配额，避免创建第二个池失败时泄漏第一个池
+		if (defaultBufs == 0 || tempBufs == 0)
+			throw std::invalid_argument("default and temp pools need at least one frame each");
+		if (defaultBufs + tempBufs > totalBufs)
+			throw std::invalid_argument("default and temp pool quotas exceed the total frame count");
+		createPool(DEFAULT_POOL, defaultBufs, totalBufs - tempBufs);
+		try
+		{
+			createPool(TEMP_POOL, tempBufs, totalBufs - defaultBufs);
+		}
+		catch (...)
+		{
+			delete pools[DEFAULT_POOL].bufMgr;
+			throw;
+		}
+	}
+
+	// 释放所有缓冲池，BufMgr 的析构函数负责将脏页写回磁盘
+	BufPoolManager::~BufPoolManager()
+	{
+		for (std::map<std::string, BufPool>::iterator it = pools.begin(); it != pools.end(); ++it)
+			delete it->second.bufMgr;
+	}
+
+	// 创建一个名为 name 的缓冲池，初始大小为 minBufs，之后可在 [minBufs, maxBufs] 内调整
+	void BufPoolManager::createPool(const std::string &name, std::uint32_t minBufs, std::uint32_t maxBufs)
+	{
+		if (pools.count(name))
+			throw std::invalid_argument("buffer pool already exists: " + name);
+		if (minBufs == 0 || minBufs > maxBufs)
+			throw std::invalid_argument("bad frame quota for buffer pool: " + name);
+		// 剩余页框不足以满足该池的最小配额
+		if (usedBufs + minBufs > totalBufs)
+			throw BufferExceededException();
+
+		BufPool pool;
+		pool.bufMgr = new BufMgr(minBufs);
+		pool.numBufs = minBufs;
+		pool.minBufs = minBufs;
+		pool.maxBufs = maxBufs;
+		pool.reservedBufs = 0;
+		pools[name] = pool;
+		usedBufs += minBufs;
+	}
+
+	// 运行时调整缓冲池大小；BufMgr对象保持不变，已取得的BufMgr指针和已pin住的页面仍然有效。
+	// 缩小时不能低于已预留的页框数，被删除的页框中有页面被pin时抛出PagePinnedException异常
+	void BufPoolManager::resizePool(const std::string &name, std::uint32_t bufs)
+	{
+		BufPool &pool = lookupPool(name);
+		if (bufs == pool.numBufs)
+			return;
+		if (bufs < pool.minBufs || bufs > pool.maxBufs)
+			throw std::invalid_argument("frame count outside the quota of buffer pool: " + name);
+		if (bufs < pool.reservedBufs)
+			throw std::invalid_argument("cannot shrink buffer pool below its reserved frames: " + name);
+		if (usedBufs - pool.numBufs + bufs > totalBufs)
+			throw BufferExceededException();
+
+		pool.bufMgr->resize(bufs);
+		usedBufs = usedBufs - pool.numBufs + bufs;
+		pool.numBufs = bufs;
+	}
+
+	// 为算子在文件file所在的缓冲池中预留 bufs 个页框，池中未预留的页框不足时抛出BufferExceededException异常
+	void BufPoolManager::reserveFrames(const File *file, std::uint32_t bufs)
+	{
+		BufPool &pool = poolEntryFor(file);
+		if (pool.reservedBufs + bufs > pool.numBufs)
+			throw BufferExceededException();
+		pool.reservedBufs += bufs;
+	}
+
+	// 归还 reserveFrames() 预留的页框
+	void BufPoolManager::releaseFrames(const File *file, std::uint32_t bufs)
+	{
+		BufPool &pool = poolEntryFor(file);
+		if (bufs > pool.reservedBufs)
+			bufs = pool.reservedBufs;
+		pool.reservedBufs -= bufs;
+	}
+
+	// 将文件file的页面路由到名为 name 的缓冲池，未路由的文件使用默认池
+	void BufPoolManager::routeFile(const File *file, const std::string &name)
+	{
+		BufPool &new_pool = lookupPool(name);
+		BufPool &old_pool = poolEntryFor(file);
+		// 文件换池前必须先从原池中清出，否则两个池中会同时缓存同一页面；
+		// flushFile()在修改任何页框之前检查pin，有页面被pin时文件仍完整地留在原池中
+		if (&old_pool != &new_pool)
+			old_pool.bufMgr->flushFile(file);
+		fileRoutes[file] = name;
+	}
+
+	// 将连接、排序产生的临时文件和结果文件路由到临时池，避免与热点页面争用页框
+	void BufPoolManager::routeTempFile(const File *file)
+	{
+		routeFile(file, TEMP_POOL);
+	}
+
+	// 将文件file从其所在的缓冲池中清出并删除路由，File对象销毁前必须调用
+	void BufPoolManager::unrouteFile(const File *file)
+	{
+		poolEntryFor(file).bufMgr->flushFile(file);
+		fileRoutes.erase(file);
+	}
+
+	BufMgr *BufPoolManager::getPool(const std::string &name)
+	{
+		return lookupPool(name).bufMgr;
+	}
+
+	std::uint32_t BufPoolManager::getPoolSize(const std::string &name)
+	{
+		return lookupPool(name).numBufs;
+	}
+
+	BufMgr *BufPoolManager::poolFor(const File *file)
+	{
+		return poolEntryFor(file).bufMgr;
+	}
+
+	std::uint32_t BufPoolManager::getPoolSizeFor(const File *file)
+	{
+		return poolEntryFor(file).numBufs;
+	}
+
+	void BufPoolManager::readPage(File *file, const PageId pageNo, Page *&page)
+	{
+		poolEntryFor(file).bufMgr->readPage(file, pageNo, page);
+	}
+
+	void BufPoolManager::unPinPage(File *file, const PageId pageNo, const bool dirty)
+	{
+		poolEntryFor(file).bufMgr->unPinPage(file, pageNo, dirty);
+	}
+
+	void BufPoolManager::allocPage(File *file, PageId &pageNo, Page *&page)
+	{
+		poolEntryFor(file).bufMgr->allocPage(file, pageNo, page);
+	}
+
+	void BufPoolManager::disposePage(File *file, const PageId pageNo)
+	{
+		poolEntryFor(file).bufMgr->disposePage(file, pageNo);
+	}
+
+	void BufPoolManager::flushFile(const File *file)
+	{
+		poolEntryFor(file).bufMgr->flushFile(file);
+	}
+
+	BufPoolManager::BufPool &BufPoolManager::lookupPool(const std::string &name)
+	{
+		std::map<std::string, BufPool>::iterator it = pools.find(name);
+		if (it == pools.end())
+			throw std::invalid_argument("no such buffer pool: " + name);
+		return it->second;
+	}
+
+	BufPoolManager::BufPool &BufPoolManager::poolEntryFor(const File *file)
+	{
+		std::map<const File *, std::string>::iterator it = fileRoutes.find(file);
+		if (it == fileRoutes.end())
+			return lookupPool(DEFAULT_POOL);
+		return lookupPool(it->second);
+	}
+
+	void BufPoolManager::printSelf(void)
+	{
+		for (std::map<std::string, BufPool>::iterator it = pools.begin(); it != pools.end(); ++it)
+		{
+			std::cout << "pool:" << it->first << " frames:" << it->second.numBufs
+					  << " min:" << it->second.minBufs << " max:" << it->second.maxBufs << "\n";
+			it->second.bufMgr->printSelf();
+		}
+		std::cout << "Total Frames Used:" << usedBufs << "/" << totalBufs << "\n";
+	}
+
 }
@@ -7,10 +7,10 @@
 #include "executor.h"
 
 #include <exceptions/buffer_exceeded_exception.h>
-#include <cmath>
 #include <ctime>
 #include <functional>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 
@@ -23,69 +23,355 @@ using namespace std;
 namespace badgerdb
 {
 
-  void TableScanner::print() const
+  /**
+   * decode an INT attribute, which is stored as 4 base-128 digits
+   * @param bytes
+   * @return
+   */
+  static int decode_int(const char *bytes)
+  {
+    int value = 0;
+    for (int j = 0; j < 4; ++j)
+      value = value * 128 + bytes[j];
+    return value;
+  }
+
+  /**
+   * compute the byte offset and length of every attribute whose position does
+   * not depend on a preceding VARCHAR, plus where the first VARCHAR starts
+   * @param tableSchema
+   * @param offsets
+   * @param lens
+   * @param varchar_start
+   * @return index of the first VARCHAR, or the attribute count if there is none
+   */
+  static int compute_fixed_layout(const TableSchema &tableSchema,
+                                  vector<int> &offsets,
+                                  vector<int> &lens,
+                                  int &varchar_start)
+  {
+    offsets.assign(tableSchema.getAttrCount(), 0);
+    lens.assign(tableSchema.getAttrCount(), 0);
+    int current_index = 0;
+    for (int i = 0; i < tableSchema.getAttrCount(); ++i)
+    {
+      offsets[i] = current_index;
+      varchar_start = current_index;
+      switch (tableSchema.getAttrType(i))
+      {
+      case INT:
+      {
+        lens[i] = 4;
+        current_index += 4;
+        break;
+      }
+      case CHAR:
+      {
+        int max_len = tableSchema.getAttrMaxSize(i);
+        lens[i] = max_len;
+        current_index += max_len;
+        current_index += (4 - (max_len % 4)) % 4; // align to the multiple of 4
+        break;
+      }
+      case VARCHAR:
+        return i;
+      }
+    }
+    return tableSchema.getAttrCount();
+  }
+
+  /**
+   * resolve the offsets and lengths of the attributes from the first VARCHAR
+   * on, walking the raw tuple once
+   * @param key
+   * @param tableSchema
+   * @param first_varchar
+   * @param varchar_start
+   * @param offsets
+   * @param lens
+   */
+  static void resolve_attrs(const string &key,
+                            const TableSchema &tableSchema,
+                            int first_varchar,
+                            int varchar_start,
+                            vector<int> &offsets,
+                            vector<int> &lens)
+  {
+    int current_index = varchar_start;
+    for (int i = first_varchar; i < tableSchema.getAttrCount(); ++i)
+    {
+      switch (tableSchema.getAttrType(i))
+      {
+      case INT:
+      {
+        offsets[i] = current_index;
+        lens[i] = 4;
+        current_index += 4;
+        break;
+      }
+      case CHAR:
+      {
+        int max_len = tableSchema.getAttrMaxSize(i);
+        offsets[i] = current_index;
+        lens[i] = max_len;
+        current_index += max_len;
+        current_index += (4 - (max_len % 4)) % 4; // align to the multiple of 4
+        break;
+      }
+      case VARCHAR:
+      {
+        int actual_len = key[current_index];
+        offsets[i] = current_index + 1;
+        lens[i] = actual_len;
+        current_index += 1 + actual_len;
+        current_index +=
+            (4 - ((actual_len + 1) % 4)) % 4; // align to the multiple of 4
+        break;
+      }
+      }
+    }
+  }
+
+  ScanTuple::ScanTuple(string key,
+                       const vector<int> &offsets,
+                       const vector<int> &lens)
+      : key(std::move(key)),
+        offsets(&offsets),
+        lens(&lens)
+  {
+    // nothing
+  }
+
+  // a copy owns its layout, so it stays valid after the scan moves on
+  ScanTuple::ScanTuple(const ScanTuple &other)
+      : key(other.key),
+        ownOffsets(*other.offsets),
+        ownLens(*other.lens),
+        offsets(&ownOffsets),
+        lens(&ownLens)
+  {
+    // nothing
+  }
+
+  ScanTuple &ScanTuple::operator=(const ScanTuple &other)
+  {
+    if (this != &other)
+    {
+      key = other.key;
+      ownOffsets = *other.offsets;
+      ownLens = *other.lens;
+      offsets = &ownOffsets;
+      lens = &ownLens;
+    }
+    return *this;
+  }
+
+  int ScanTuple::getInt(int attrIndex) const
+  {
+    return decode_int(key.data() + (*offsets)[attrIndex]);
+  }
+
+  string ScanTuple::getString(int attrIndex) const
+  {
+    return std::string(key, (*offsets)[attrIndex], (*lens)[attrIndex]);
+  }
+
+  /**
+   * a ScanPredicate whose attribute has been resolved against the schema and
+   * whose INT literals have been parsed, so it can be tested on raw bytes
+   */
+  struct BoundPredicate
+  {
+    int attrIndex;
+    DataType attrType;
+    ScanPredicate::Op op;
+    vector<int> intValues;
+    vector<string> strValues;
+  };
+
+  /**
+   * parse the literal of a predicate on an INT attribute, rejecting anything
+   * that is not entirely a number in the range of int
+   * @param literal
+   * @return
+   */
+  static int parse_int_literal(const string &literal)
+  {
+    size_t pos = 0;
+    int value;
+    try
+    {
+      value = stoi(literal, &pos);
+    }
+    catch (logic_error &) // invalid_argument or out_of_range
+    {
+      pos = 0;
+    }
+    if (pos == 0 || pos != literal.size())
+      throw invalid_argument("bad INT literal in scan predicate: " + literal);
+    return value;
+  }
+
+  static BoundPredicate bind_predicate(const ScanPredicate &predicate,
+                                       const TableSchema &tableSchema)
   {
-    badgerdb::File file = badgerdb::File::open(tableFile.filename());
-    for (badgerdb::FileIterator iter = file.begin(); iter != file.end(); ++iter)
+    BoundPredicate bound;
+    bound.attrIndex = -1;
+    for (int i = 0; i < tableSchema.getAttrCount(); ++i)
+    {
+      if (tableSchema.getAttrName(i) == predicate.attrName)
+      {
+        bound.attrIndex = i;
+        break;
+      }
+    }
+    if (bound.attrIndex < 0)
+      throw invalid_argument("unknown attribute in scan predicate: " +
+                             predicate.attrName);
+    if (predicate.op == ScanPredicate::RANGE && predicate.values.size() != 2)
+      throw invalid_argument("range predicate needs a low and a high value");
+    if (predicate.op == ScanPredicate::EQUAL && predicate.values.size() != 1)
+      throw invalid_argument("equality predicate needs exactly one value");
+    if (predicate.op == ScanPredicate::IN_LIST && predicate.values.empty())
+      throw invalid_argument("in-list predicate needs at least one value");
+
+    bound.attrType = tableSchema.getAttrType(bound.attrIndex);
+    bound.op = predicate.op;
+    for (int i = 0; i < predicate.values.size(); ++i)
+    {
+      if (bound.attrType == INT)
+        bound.intValues.push_back(parse_int_literal(predicate.values[i]));
+      else
+        bound.strValues.push_back(predicate.values[i]);
+    }
+    return bound;
+  }
+
+  /**
+   * compare the stored bytes of a CHAR/VARCHAR attribute with a literal,
+   * ignoring the '\0' padding of CHAR values
+   */
+  static int compare_attr_bytes(const char *data, int len, const string &literal)
+  {
+    while (len > 0 && data[len - 1] == '\0')
+      --len;
+    return -literal.compare(0, string::npos, data, len);
+  }
+
+  static bool test_predicate(const BoundPredicate &predicate,
+                             const string &key,
+                             const vector<int> &offsets,
+                             const vector<int> &lens)
+  {
+    const char *data = key.data() + offsets[predicate.attrIndex];
+    int len = lens[predicate.attrIndex];
+
+    if (predicate.attrType == INT)
+    {
+      int value = decode_int(data);
+      switch (predicate.op)
+      {
+      case ScanPredicate::EQUAL:
+        return value == predicate.intValues[0];
+      case ScanPredicate::RANGE:
+        return value >= predicate.intValues[0] && value <= predicate.intValues[1];
+      case ScanPredicate::IN_LIST:
+        for (int i = 0; i < predicate.intValues.size(); ++i)
+          if (value == predicate.intValues[i])
+            return true;
+        return false;
+      }
+      return false;
+    }
+
+    switch (predicate.op)
+    {
+    case ScanPredicate::EQUAL:
+      return compare_attr_bytes(data, len, predicate.strValues[0]) == 0;
+    case ScanPredicate::RANGE:
+      return compare_attr_bytes(data, len, predicate.strValues[0]) >= 0 &&
+             compare_attr_bytes(data, len, predicate.strValues[1]) <= 0;
+    case ScanPredicate::IN_LIST:
+      for (int i = 0; i < predicate.strValues.size(); ++i)
+        if (compare_attr_bytes(data, len, predicate.strValues[i]) == 0)
+          return true;
+      return false;
+    }
+    return false;
+  }
+
+  int TableScanner::scan(const vector<ScanPredicate> &predicates,
+                         const function<void(const ScanTuple &)> &consumer) const
+  {
+    vector<int> offsets, lens;
+    int varchar_start = 0;
+    int first_varchar =
+        compute_fixed_layout(tableSchema, offsets, lens, varchar_start);
+    bool has_varchar = first_varchar < tableSchema.getAttrCount();
+
+    // the tuple only has to be walked before filtering if some predicate
+    // looks at an attribute whose offset or length depends on a VARCHAR
+    bool walk_before_filter = false;
+    vector<BoundPredicate> bound_predicates;
+    for (int i = 0; i < predicates.size(); ++i)
+    {
+      bound_predicates.push_back(bind_predicate(predicates[i], tableSchema));
+      if (bound_predicates.back().attrIndex >= first_varchar)
+        walk_before_filter = true;
+    }
+
+    // scan through the caller's File object, so that pages land in the pool
+    // that file is routed to and stay cached for the next scan
+    int num_matched = 0;
+    for (badgerdb::FileIterator iter = tableFile.begin(); iter != tableFile.end(); ++iter)
     {
       badgerdb::Page page = *iter;
       badgerdb::Page *buffered_page;
-      bufMgr->readPage(&file, page.page_number(), buffered_page);
+      bufMgr->readPage(&tableFile, page.page_number(), buffered_page);
 
       for (badgerdb::PageIterator page_iter = buffered_page->begin();
            page_iter != buffered_page->end(); ++page_iter)
       {
         string key = *page_iter;
-        string print_key = "(";
-        int current_index = 0;
-        for (int i = 0; i < tableSchema.getAttrCount(); ++i)
-        {
-          switch (tableSchema.getAttrType(i))
-          {
-          case INT:
-          {
-            int true_value = 0;
-            for (int j = 0; j < 4; ++j)
-            {
-              if (std::string(key, current_index + j, 1)[0] == '\0')
-              {
-                continue; // \0 is actually representing 0
-              }
-              true_value +=
-                  (std::string(key, current_index + j, 1))[0] * pow(128, 3 - j);
-            }
-            print_key += to_string(true_value);
-            current_index += 4;
-            break;
-          }
-          case CHAR:
-          {
-            int max_len = tableSchema.getAttrMaxSize(i);
-            print_key += std::string(key, current_index, max_len);
-            current_index += max_len;
-            current_index +=
-                (4 - (max_len % 4)) % 4; // align to the multiple of 4
-            break;
-          }
-          case VARCHAR:
-          {
-            int actual_len = key[current_index];
-            current_index++;
-            print_key += std::string(key, current_index, actual_len);
-            current_index += actual_len;
-            current_index +=
-                (4 - ((actual_len + 1) % 4)) % 4; // align to the multiple of 4
-            break;
-          }
-          }
-          print_key += ",";
-        }
-        print_key[print_key.size() - 1] = ')'; // change the last ',' to ')'
-        cout << print_key << endl;
+        if (has_varchar && walk_before_filter)
+          resolve_attrs(key, tableSchema, first_varchar, varchar_start,
+                        offsets, lens);
+
+        bool matched = true;
+        for (int i = 0; i < bound_predicates.size() && matched; ++i)
+          matched = test_predicate(bound_predicates[i], key, offsets, lens);
+        if (!matched)
+          continue;
+
+        if (has_varchar && !walk_before_filter)
+          resolve_attrs(key, tableSchema, first_varchar, varchar_start,
+                        offsets, lens);
+        num_matched++;
+        // attributes are only decoded when the consumer asks for them; the
+        // tuple shares this scan's layout until the consumer copies it
+        consumer(ScanTuple(std::move(key), offsets, lens));
       }
-      bufMgr->unPinPage(&file, page.page_number(), false);
+      bufMgr->unPinPage(&tableFile, page.page_number(), false);
     }
-    bufMgr->flushFile(&file);
+    return num_matched;
+  }
+
+  void TableScanner::print() const
+  {
+    scan(vector<ScanPredicate>(), [this](const ScanTuple &tuple)
+         {
+           string print_key = "(";
+           for (int i = 0; i < tableSchema.getAttrCount(); ++i)
+           {
+             if (tableSchema.getAttrType(i) == INT)
+               print_key += to_string(tuple.getInt(i));
+             else
+               print_key += tuple.getString(i);
+             print_key += ",";
+           }
+           print_key[print_key.size() - 1] = ')'; // change the last ',' to ')'
+           cout << print_key << endl;
+         });
   }
 
   JoinOperator::JoinOperator(File &leftTableFile,
@@ -93,7 +379,7 @@ namespace badgerdb
                              const TableSchema &leftTableSchema,
                              const TableSchema &rightTableSchema,
                              const Catalog *catalog,
-                             BufMgr *bufMgr)
+                             BufPoolManager *bufPools)
       : leftTableFile(leftTableFile),
         rightTableFile(rightTableFile),
         leftTableSchema(leftTableSchema),
@@ -101,7 +387,7 @@ namespace badgerdb
         resultTableSchema(
             createResultTableSchema(leftTableSchema, rightTableSchema)),
         catalog(catalog),
-        bufMgr(bufMgr),
+        bufPools(bufPools),
         isComplete(false)
   {
     // nothing
@@ -352,73 +638,132 @@ namespace badgerdb
     vector<string> result_list;                                                              // 保存结果
     vector<Attribute> common_attrs = getCommonAttributes(leftTableSchema, rightTableSchema); // 寻找两个表的公共部分
     badgerdb::FileIterator iter = leftTableFile.begin();                                     // 获取S关系的头指针
-    while (iter != leftTableFile.end())
+    int num_pinned = 0;                                                                      // 当前被pin住的页面数
+
+    // 外关系至少占一块、内关系占一块
+    if (numAvailableBufPages < 2)
+      throw BufferExceededException();
+    // 在两个关系所在的缓冲池中为本算子预留页框：同池时预留M块，否则外关系的池M-1块、内关系的池1块
+    bool same_pool = bufPools->poolFor(&leftTableFile) == bufPools->poolFor(&rightTableFile);
+    std::uint32_t left_reserved = same_pool ? numAvailableBufPages : numAvailableBufPages - 1;
+    bufPools->reserveFrames(&leftTableFile, left_reserved);
+    if (!same_pool)
     {
-      // 将外关系S的M-1个块读入缓存池
-      vector<badgerdb::Page *> used_list; // 保存读入缓存的块
-      for (int i = 0; i < numAvailableBufPages - 1; i++)
+      try
       {
-        badgerdb::Page *buffered_page;
-        badgerdb::Page page = *iter;
-
-        bufMgr->readPage(&leftTableFile, page.page_number(), buffered_page);
-        used_list.push_back(buffered_page);
-
-        numUsedBufPages++; // 更新使用的页面数
-        numIOs++;          // 更新IO数
-
-        if (++iter == leftTableFile.end()) // 若S关系中的元组提前读完
-          break;
+        bufPools->reserveFrames(&rightTableFile, 1);
+      }
+      catch (...)
+      {
+        bufPools->releaseFrames(&leftTableFile, left_reserved);
+        throw;
       }
+    }
 
-      // 每次读入并处理外关系R中的一个块P
-      for (badgerdb::FileIterator iter = rightTableFile.begin(); iter != rightTableFile.end(); iter++)
+    vector<badgerdb::Page *> used_list; // 保存读入缓存的块
+    vector<PageId> used_page_nos;       // 保存读入缓存的块的页号，用于unpin
+    bool right_pinned = false;          // 内关系当前块是否被pin住
+    PageId right_page_no = 0;
+    try
+    {
+      while (iter != leftTableFile.end())
       {
-        badgerdb::Page page = *iter;
-        badgerdb::Page *buffered_page;
+        // 将外关系S的M-1个块读入缓存池
+        used_list.clear();
+        used_page_nos.clear();
+        for (int i = 0; i < numAvailableBufPages - 1; i++)
+        {
+          badgerdb::Page *buffered_page;
+          badgerdb::Page page = *iter;
 
-        bufMgr->readPage(&rightTableFile, page.page_number(), buffered_page);
+          bufPools->readPage(&leftTableFile, page.page_number(), buffered_page);
+          used_list.push_back(buffered_page);
+          used_page_nos.push_back(page.page_number());
 
-        numUsedBufPages++;
-        numIOs++;
+          num_pinned++;
+          numUsedBufPages = max(numUsedBufPages, num_pinned); // 更新使用的页面数
+          numIOs++;                                           // 更新IO数
 
-        for (badgerdb::PageIterator page_iter = buffered_page->begin();
-             page_iter != buffered_page->end(); ++page_iter)
+          if (++iter == leftTableFile.end()) // 若S关系中的元组提前读完
+            break;
+        }
+
+        // 每次读入并处理外关系R中的一个块P
+        for (badgerdb::FileIterator iter = rightTableFile.begin(); iter != rightTableFile.end(); iter++)
         {
-          string rightKey = *page_iter;
-          string key_right_flag = construct_search_key(rightKey, common_attrs, rightTableSchema);
-          // 查找能与r元组进行连接的元组s
-          for (int i = 0; i < used_list.size(); i++) // 遍历缓存块
+          badgerdb::Page page = *iter;
+          badgerdb::Page *buffered_page;
+
+          bufPools->readPage(&rightTableFile, page.page_number(), buffered_page);
+          right_pinned = true;
+          right_page_no = page.page_number();
+
+          num_pinned++;
+          numUsedBufPages = max(numUsedBufPages, num_pinned);
+          numIOs++;
+
+          for (badgerdb::PageIterator page_iter = buffered_page->begin();
+               page_iter != buffered_page->end(); ++page_iter)
           {
-            badgerdb::Page *buffered_page_left = used_list.at(i);
-            for (badgerdb::PageIterator page_iter_left = buffered_page_left->begin(); // 从头开始关系S的遍历
-                 page_iter_left != buffered_page_left->end(); page_iter_left++)
+            string rightKey = *page_iter;
+            string key_right_flag = construct_search_key(rightKey, common_attrs, rightTableSchema);
+            // 查找能与r元组进行连接的元组s
+            for (int i = 0; i < used_list.size(); i++) // 遍历缓存块
             {
-              string result_tuple;
-              string leftKey = *page_iter_left;
-              string key_left_flag = construct_search_key(leftKey, common_attrs, leftTableSchema); // 寻找含有共同部分的元组
-
-              // 判断是否相等
-              if (key_left_flag == key_right_flag)
+              badgerdb::Page *buffered_page_left = used_list.at(i);
+              for (badgerdb::PageIterator page_iter_left = buffered_page_left->begin(); // 从头开始关系S的遍历
+                   page_iter_left != buffered_page_left->end(); page_iter_left++)
               {
-                result_tuple = joinTuples(leftKey, rightKey, leftTableSchema, rightTableSchema);
-                result_list.push_back(result_tuple);
+                string result_tuple;
+                string leftKey = *page_iter_left;
+                string key_left_flag = construct_search_key(leftKey, common_attrs, leftTableSchema); // 寻找含有共同部分的元组
+
+                // 判断是否相等
+                if (key_left_flag == key_right_flag)
+                {
+                  result_tuple = joinTuples(leftKey, rightKey, leftTableSchema, rightTableSchema);
+                  result_list.push_back(result_tuple);
+                }
               }
             }
           }
+          right_pinned = false;
+          bufPools->unPinPage(&rightTableFile, page.page_number(), false);
+          num_pinned--;
         }
+
+        // 外关系的当前M-1块处理完毕，释放其页框
+        vector<PageId> unpinned_page_nos;
+        unpinned_page_nos.swap(used_page_nos);
+        for (int i = 0; i < unpinned_page_nos.size(); i++)
+          bufPools->unPinPage(&leftTableFile, unpinned_page_nos.at(i), false);
+        num_pinned -= unpinned_page_nos.size();
       }
     }
+    catch (...)
+    {
+      // 中途失败（如缓冲池被其他页面占满）时释放本算子pin住的页面和预留的页框，避免页面一直被pin住
+      if (right_pinned)
+        bufPools->unPinPage(&rightTableFile, right_page_no, false);
+      for (int i = 0; i < used_page_nos.size(); i++)
+        bufPools->unPinPage(&leftTableFile, used_page_nos.at(i), false);
+      bufPools->releaseFrames(&leftTableFile, left_reserved);
+      if (!same_pool)
+        bufPools->releaseFrames(&rightTableFile, 1);
+      throw;
+    }
+    bufPools->releaseFrames(&leftTableFile, left_reserved);
+    if (!same_pool)
+      bufPools->releaseFrames(&rightTableFile, 1);
 
-    // 将结果写入文件
+    // 将结果写入文件；结果文件走临时池，不占用本算子预留的页框，也不挤占基本表的热点页面
+    bufPools->routeTempFile(&resultFile);
+    BufMgr *temp_pool = bufPools->getPool(BufPoolManager::TEMP_POOL);
     for (int i = 0; i < result_list.size(); i++)
-      HeapFileManager::insertTuple(result_list.at(i), resultFile, bufMgr);
+      HeapFileManager::insertTuple(result_list.at(i), resultFile, temp_pool);
+    bufPools->unrouteFile(&resultFile); // 结果写回磁盘，之后可按文件名重新打开
 
     numResultTuples = result_list.size(); // 更新 numResultTuples
-    if (numUsedBufPages > numAvailableBufPages)
-      numUsedBufPages = numAvailableBufPages; // 使用的缓存块数不能超过 numAvailableBufPages
-    else
-      numUsedBufPages = numUsedBufPages;
 
     isComplete = true;
     return true;